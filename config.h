@@ -1,4 +1,11 @@
 #pragma once
 
-inline constexpr int width = 3000;
-constexpr int height = 3000;
\ No newline at end of file
+// default resolution, overridden at runtime by --size or a job's width/height
+inline constexpr int default_width = 3000;
+inline constexpr int default_height = 3000;
+
+// largest frame viewport() is set up for, and largest target one render
+// allocates (TGA stores its size in 16 bits; 1<<26 pixels is ~470 MB with the zbuffer)
+inline constexpr int max_frame_dimension = 1 << 20;
+inline constexpr int max_target_dimension = 65535;
+inline constexpr long long max_target_pixels = 1LL << 26;
\ No newline at end of file
@@ -3,7 +3,7 @@
 #include "config.h"
 #include <iostream>
 
-mat<4,4> ModelView, Viewport, Perspective;
+thread_local mat<4,4> ModelView, Viewport, Perspective;
 void lookat(const vec3 eye, const vec3 center, const vec3 up) {
     vec3 z = normalized(eye - center);      // camera forward
     vec3 x = normalized(cross(up, z));      // camera right
@@ -34,10 +34,30 @@ void viewport(const int x, const int y, const int w, const int h) {
                  {0,    0,    0, 1}}};
 }
 
+// products are taken in 64 bits: in int they overflow once a frame passes ~32k pixels
+static_assert(2LL * max_frame_dimension * 2 * max_frame_dimension * 3 < (1LL << 62));
 double signed_triangle_area(int ax,int ay,int bx,int by,int cx,int cy) {
-    return 0.5 * ((by-ay)*(bx+ax) + (cy-by)*(cx+bx) + (ay-cy)*(ax+cx));
+    const long long Ax = ax, Ay = ay, Bx = bx, By = by, Cx = cx, Cy = cy;
+    return 0.5 * ((By-Ay)*(Bx+Ax) + (Cy-By)*(Cx+Bx) + (Ay-Cy)*(Ax+Cx));
 }
+const char *region_error(const int width, const int height, const Region &region) {
+    if (width <= 0 || height <= 0 || width > max_frame_dimension || height > max_frame_dimension)
+        return "frame size out of range";
+    const long long x = region.x, y = region.y, w = region.w, h = region.h;
+    if (w <= 0 || h <= 0)
+        return "region must not be empty";
+    if (x < 0 || y < 0 || x + w > width || y + h > height)
+        return "region must lie inside the frame";
+    if (w > max_target_dimension || h > max_target_dimension || w * h > max_target_pixels)
+        return "region too large for a single render";
+    return nullptr;
+}
+
 void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer, std::vector<float> &zbuffer) {
+    rasterize(clip, shader, framebuffer, zbuffer, {0, 0, framebuffer.width(), framebuffer.height()});
+}
+
+void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer, std::vector<float> &zbuffer, const Region &region) {
     static bool once = false;
     // --- clip space → screen space ---
     vec3 pts[3];
@@ -47,15 +67,19 @@ void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffe
         pts[i] = scr.xyz();
     }
 
-    // --- bounding box ---
-    int minX = width - 1, minY = height - 1;
-    int maxX = 0, maxY = 0;
+    // --- bounding box, clipped to the region the target holds ---
+    const int w = std::min(region.w, framebuffer.width());
+    const int h = std::min(region.h, framebuffer.height());
+    const int x0 = region.x, y0 = region.y;
+    const int x1 = region.x + w - 1, y1 = region.y + h - 1;
+    int minX = x1, minY = y1;
+    int maxX = x0, maxY = y0;
 
     for (int i = 0; i < 3; i++) {
-        minX = std::max(0, std::min(minX, int(pts[i].x)));
-        minY = std::max(0, std::min(minY, int(pts[i].y)));
-        maxX = std::min(width  - 1, std::max(maxX, int(pts[i].x)));
-        maxY = std::min(height - 1, std::max(maxY, int(pts[i].y)));
+        minX = std::max(x0, std::min(minX, int(pts[i].x)));
+        minY = std::max(y0, std::min(minY, int(pts[i].y)));
+        maxX = std::min(x1, std::max(maxX, int(pts[i].x)));
+        maxY = std::min(y1, std::max(maxY, int(pts[i].y)));
     }
 
     double total = signed_triangle_area(
@@ -93,7 +117,7 @@ void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffe
                 pts[2].z * g
             );
 
-            int id = x + y * width;
+            int id = (x - x0) + (y - y0) * framebuffer.width();
             if (z <= zbuffer[id]) continue;
 
             // fragment shader
@@ -101,7 +125,7 @@ void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffe
             if (discard) continue;
 
             zbuffer[id] = z;
-            framebuffer.set(x, y, color);
+            framebuffer.set(x - x0, y - y0, color);
         }
     }
 }
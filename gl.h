@@ -1,11 +1,13 @@
+#pragma once
 #include "tgaimage.h"
 #include "geometry.h"
 
 using namespace std;
 
-extern mat<4,4> ModelView;
-extern mat<4,4> Viewport;
-extern mat<4,4> Perspective;
+// per thread, so concurrent renders (see server.h) don't clobber each other's camera
+extern thread_local mat<4,4> ModelView;
+extern thread_local mat<4,4> Viewport;
+extern thread_local mat<4,4> Perspective;
 
 void lookat(const vec3 eye, const vec3 center, const vec3 up);
 void perspective(const double f);
@@ -15,8 +17,21 @@ struct IShader {
     virtual pair<bool, TGAColor> fragment(const vec3 bar) const = 0;
 };
 
+// A rectangle of the full frame (the one set up by viewport()), in the same
+// pixel coordinates as TGAImage::set. A render target holding only this
+// rectangle has region.w x region.h pixels, pixel (x,y) of the frame landing
+// at (x-region.x, y-region.y); tiles rendered separately stitch back exactly.
+struct Region {
+    int x = 0, y = 0, w = 0, h = 0;
+};
+
 typedef vec4 Triangle[3];
 double signed_triangle_area(int ax,int ay,int bx,int by,int cx,int cy);
+// why region can't be rendered out of a width x height frame, nullptr if it can
+const char *region_error(const int width, const int height, const Region &region);
+// the whole framebuffer is the frame
 void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer, std::vector<float> &zbuffer);
+// the framebuffer (and zbuffer) only hold the given region of the frame
+void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer, std::vector<float> &zbuffer, const Region &region);
 void line(int ax, int ay, int bx, int by, TGAImage &framebuffer, TGAColor color);
 void triangle_scanline(int ax, int ay, int bx, int by, int cx, int cy, TGAImage &framebuffer, TGAColor color);
@@ -0,0 +1,262 @@
+#include "lod.h"
+#include "gl.h"
+#include <array>
+#include <queue>
+#include <map>
+#include <algorithm>
+#include <iterator>
+
+namespace {
+    // symmetric 4x4 matrix of a sum of squared plane distances, upper triangle only
+    struct Quadric {
+        double q[10] = {0};   // aa ab ac ad bb bc bd cc cd dd
+
+        Quadric() = default;
+        Quadric(const double a, const double b, const double c, const double d, const double weight = 1)
+            : q{a*a*weight, a*b*weight, a*c*weight, a*d*weight, b*b*weight, b*c*weight, b*d*weight, c*c*weight, c*d*weight, d*d*weight} {}
+
+        Quadric& operator+=(const Quadric &o) {
+            for (int i=10; i--; q[i]+=o.q[i]);
+            return *this;
+        }
+
+        double error(const vec3 &v) const {
+            return q[0]*v.x*v.x + 2*q[1]*v.x*v.y + 2*q[2]*v.x*v.z + 2*q[3]*v.x
+                 + q[4]*v.y*v.y + 2*q[5]*v.y*v.z + 2*q[6]*v.y
+                 + q[7]*v.z*v.z + 2*q[8]*v.z
+                 + q[9];
+        }
+
+        // position minimizing the error, false if the system is (close to) singular
+        bool optimum(vec3 &v) const {
+            mat<3,3> A = {{{q[0], q[1], q[2]}, {q[1], q[4], q[5]}, {q[2], q[5], q[7]}}};
+            double trace = q[0] + q[4] + q[7];
+            if (std::abs(A.det()) <= 1e-9 * trace*trace*trace) return false;
+            v = A.invert() * vec3{-q[3], -q[6], -q[8]};
+            return true;
+        }
+    };
+
+    struct Collapse {
+        double cost;
+        int u, v;               // v is merged into u
+        int stamp_u, stamp_v;   // vertex versions the candidate was computed for
+        vec3 target;
+        bool operator>(const Collapse &o) const { return cost > o.cost; }
+    };
+
+    class Simplifier {
+        public:
+        Simplifier(const Model &model) : pos(model.vertices), quadrics(pos.size()), vfaces(pos.size()),
+                                         vplanes(pos.size()), stamp(pos.size(), 0), vdead(pos.size(), false) {
+            std::map<std::pair<int,int>, int> edge_faces;
+            for (const std::vector<int> &f : model.faces) {
+                std::array<int,3> t = {f[0], f[1], f[2]};
+                if (t[0]==t[1] || t[1]==t[2] || t[2]==t[0]) continue;
+                int id = tris.size();
+                tris.push_back(t);
+                for (int i=0; i<3; i++) {
+                    vfaces[t[i]].push_back(id);
+                    edge_faces[std::minmax(t[i], t[(i+1)%3])]++;
+                }
+
+                vec3 n = cross(pos[t[1]] - pos[t[0]], pos[t[2]] - pos[t[0]]);
+                if (norm(n) == 0) continue;
+                n = normalized(n);
+                Quadric plane(n.x, n.y, n.z, -(n*pos[t[0]]));
+                for (int i=0; i<3; i++) quadrics[t[i]] += plane;
+                for (int i=0; i<3; i++) vplanes[t[i]].push_back(planes.size());
+                planes.push_back({n.x, n.y, n.z, -(n*pos[t[0]])});
+            }
+            fdead.assign(tris.size(), false);
+            live = tris.size();
+
+            // keep open borders in place with planes perpendicular to them
+            for (size_t id=0; id<tris.size(); id++) {
+                const std::array<int,3> &t = tris[id];
+                vec3 n = cross(pos[t[1]] - pos[t[0]], pos[t[2]] - pos[t[0]]);
+                if (norm(n) == 0) continue;
+                for (int i=0; i<3; i++) {
+                    int a = t[i], b = t[(i+1)%3];
+                    if (edge_faces[std::minmax(a, b)] != 1) continue;
+                    vec3 e = pos[b] - pos[a];
+                    vec3 m = cross(e, n);
+                    if (norm(m) == 0) continue;
+                    m = normalized(m);
+                    Quadric border(m.x, m.y, m.z, -(m*pos[a]), boundary_weight);
+                    quadrics[a] += border;
+                    quadrics[b] += border;
+                }
+            }
+
+            for (const auto &[edge, count] : edge_faces)
+                push(edge.first, edge.second);
+        }
+
+        int nfaces() const { return live; }
+        double error() const { return max_distance; }
+
+        // collapse edges until at most target faces are left, false if no edge can go
+        bool reduce(const int target) {
+            while (live > target) {
+                if (heap.empty()) return false;
+                Collapse c = heap.top();
+                heap.pop();
+                if (vdead[c.u] || vdead[c.v] || stamp[c.u] != c.stamp_u || stamp[c.v] != c.stamp_v) continue;
+                if (flips(c.u, c.v, c.target) || flips(c.v, c.u, c.target)) continue;
+                collapse(c);
+            }
+            return true;
+        }
+
+        Model snapshot() const {
+            Model model;
+            std::vector<int> remap(pos.size(), -1);
+            for (size_t id=0; id<tris.size(); id++) {
+                if (fdead[id]) continue;
+                std::vector<int> face(3);
+                for (int i=0; i<3; i++) {
+                    int &r = remap[tris[id][i]];
+                    if (r < 0) {
+                        r = model.vertices.size();
+                        model.vertices.push_back(pos[tris[id][i]]);
+                    }
+                    face[i] = r;
+                }
+                model.faces.push_back(face);
+            }
+            return model;
+        }
+
+        private:
+        static constexpr double boundary_weight = 10;
+
+        void push(const int a, const int b) {
+            Quadric q = quadrics[a];
+            q += quadrics[b];
+            // the optimum is missing for flat or straight neighbourhoods and can be
+            // numerically off for nearly degenerate ones, so the endpoints and midpoint compete
+            vec3 candidates[4] = {pos[a], pos[b], (pos[a] + pos[b]) / 2};
+            int n = q.optimum(candidates[3]) ? 4 : 3;
+            vec3 target = *std::min_element(candidates, candidates + n, [&q](const vec3 &l, const vec3 &r) {
+                return q.error(l) < q.error(r);
+            });
+            heap.push({q.error(target), a, b, stamp[a], stamp[b], target});
+        }
+
+        // true if moving u to target turns over one of its faces that survives the collapse
+        bool flips(const int u, const int v, const vec3 &target) const {
+            for (int id : vfaces[u]) {
+                if (fdead[id]) continue;
+                const std::array<int,3> &t = tris[id];
+                if (t[0]==v || t[1]==v || t[2]==v) continue;
+                vec3 p[3] = {pos[t[0]], pos[t[1]], pos[t[2]]};
+                vec3 before = cross(p[1] - p[0], p[2] - p[0]);
+                for (int i=0; i<3; i++) if (t[i]==u) p[i] = target;
+                vec3 after = cross(p[1] - p[0], p[2] - p[0]);
+                if (after*before <= 0) return true;
+            }
+            return false;
+        }
+
+        void collapse(const Collapse &c) {
+            const int u = c.u, v = c.v;
+            pos[u] = c.target;
+            quadrics[u] += quadrics[v];
+
+            // u now stands in for every source face either vertex touched; how far
+            // it sits from their planes is what the level deviates by
+            std::vector<int> merged;
+            std::set_union(vplanes[u].begin(), vplanes[u].end(), vplanes[v].begin(), vplanes[v].end(),
+                           std::back_inserter(merged));
+            vplanes[u] = std::move(merged);
+            vplanes[v] = {};
+            const vec4 p{c.target.x, c.target.y, c.target.z, 1};
+            for (int id : vplanes[u]) max_distance = std::max(max_distance, std::abs(planes[id]*p));
+
+            for (int id : vfaces[v]) {
+                if (fdead[id]) continue;
+                std::array<int,3> &t = tris[id];
+                if (t[0]==u || t[1]==u || t[2]==u) {
+                    fdead[id] = true;
+                    live--;
+                    continue;
+                }
+                for (int i=0; i<3; i++) if (t[i]==v) t[i] = u;
+                vfaces[u].push_back(id);
+            }
+            vdead[v] = true;
+            vfaces[v].clear();
+            std::erase_if(vfaces[u], [this](const int id) { return fdead[id]; });
+            stamp[u]++;
+            stamp[v]++;
+
+            std::vector<int> neighbours;
+            for (int id : vfaces[u])
+                for (int w : tris[id])
+                    if (w != u) neighbours.push_back(w);
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+            for (int w : neighbours) push(u, w);   // only edges touching u changed cost
+        }
+
+        std::vector<vec3> pos;
+        std::vector<Quadric> quadrics;
+        std::vector<std::array<int,3>> tris;
+        std::vector<std::vector<int>> vfaces;   // faces around each vertex
+        std::vector<vec4> planes;               // planes of the source faces
+        std::vector<std::vector<int>> vplanes;  // sorted source planes merged into each vertex
+        std::vector<int> stamp;
+        std::vector<bool> vdead, fdead;
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+        int live = 0;
+        double max_distance = 0;
+    };
+}
+
+LodChain::LodChain(const Model &model, const int min_faces, const int max_levels) : source(model), errors{0} {
+    vec3 lo = model.nverts() ? model.vert(0) : vec3{}, hi = lo;
+    for (const vec3 &v : model.vertices)
+        for (int i=0; i<3; i++) {
+            lo[i] = std::min(lo[i], v[i]);
+            hi[i] = std::max(hi[i], v[i]);
+        }
+    center = (lo + hi) / 2;
+    for (const vec3 &v : model.vertices) radius = std::max(radius, norm(v - center));
+
+    Simplifier simplifier(model);
+    int target = simplifier.nfaces() / 2;
+    while (int(levels.size()) < max_levels && target >= min_faces) {
+        bool reached = simplifier.reduce(target);
+        if (simplifier.nfaces() >= (levels.empty() ? model.nfaces() : levels.back().nfaces())) break;
+        levels.push_back(simplifier.snapshot());
+        errors.push_back(simplifier.error());
+        if (!reached) break;
+        target = simplifier.nfaces() / 2;
+    }
+}
+
+int LodChain::nlevels() const { return levels.size() + 1; }
+
+const Model & LodChain::level(const int i) const {
+    return i ? levels[i - 1] : source;
+}
+
+double LodChain::error(const int i) const {
+    return errors[i];
+}
+
+int LodChain::select(const double max_pixels) const {
+    // worst case: the deviation sits on the point of the bounding sphere nearest to the camera
+    vec4 c = ModelView * vec4{center.x, center.y, center.z, 1};
+    double scale = 0;   // ModelView may scale the model
+    for (int i=0; i<3; i++) scale = std::max(scale, norm(vec3{ModelView[i][0], ModelView[i][1], ModelView[i][2]}));
+    vec4 nearest{c.x, c.y, c.z + radius * scale, 1};
+    double w = Perspective[3] * nearest;
+    if (w <= 0) return 0;   // camera inside the model
+
+    double pixels_per_unit = scale * std::max(std::abs(Viewport[0][0]), std::abs(Viewport[1][1])) / w;
+    for (int i = nlevels() - 1; i > 0; i--)
+        if (errors[i] * pixels_per_unit <= max_pixels) return i;
+    return 0;
+}
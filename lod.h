@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+// Chain of progressively simplified copies of a model, built with quadric
+// error metric edge collapses (Garland & Heckbert). Level 0 is the source model
+// itself, each further level has about half the faces of the previous one.
+// The source must outlive the chain.
+class LodChain {
+    public:
+    LodChain(const Model &model, const int min_faces = 256, const int max_levels = 8);
+
+    int nlevels() const;
+    const Model & level(const int i) const;
+    // object space deviation of the level: the largest distance between a
+    // collapsed vertex and the planes of the source faces merged into it
+    double error(const int i) const;
+
+    // coarsest level whose error, projected with the current ModelView,
+    // Perspective and Viewport, stays within max_pixels
+    int select(const double max_pixels) const;
+
+    private:
+    const Model &source;
+    std::vector<Model> levels;      // levels 1..n
+    std::vector<double> errors;     // errors[0] == 0 for the source
+    vec3 center;
+    double radius = 0;
+};
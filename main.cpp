@@ -4,35 +4,66 @@
 #include "geometry.h"
 #include "gl.h"
 #include "config.h"
+#include "shader.h"
+#include "server.h"
+#include "lod.h"
 #include <iostream>
+#include <cstdio>
+#include <memory>
+#include <optional>
 using namespace std;
-struct RandomShader : IShader {
-    const Model &model;
-    vec3 tri[3];
-
-    RandomShader(const Model &model) : model(model) {}
+int main(int argc, char **argv) {
+    // usage: rend [--stream | --lod px] [--size WxH] [--region x,y,w,h] [model.obj]
+    //        rend --serve [--socket path] [--workers n] [--cache n]
+    bool stream = false, serve = false;
+    string filename = "diablo3_pose.obj", socket_path;
+    int workers = max(1u, thread::hardware_concurrency());
+    int cache_size = 4;
+    int width = default_width, height = default_height;
+    optional<Region> requested;     // the whole frame if not given
+    double lod_pixels = -1;    // negative always draws the full mesh
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stream") stream = true;
+        else if (arg == "--serve") serve = true;
+        else if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (arg == "--workers" && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (arg == "--cache" && i + 1 < argc) cache_size = atoi(argv[++i]);
+        else if (arg == "--size" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                cerr << "bad --size " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--lod" && i + 1 < argc) lod_pixels = atof(argv[++i]);
+        else if (arg == "--region" && i + 1 < argc) {
+            Region &r = requested.emplace();
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &r.x, &r.y, &r.w, &r.h) != 4) {
+                cerr << "bad --region " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else filename = arg;
+    }
 
-    virtual vec4 vertex(const int face, const int vert) {
-        vec3 v = model.vert(face, vert);
-        vec4 view_pos = ModelView * vec4{v.x, v.y, v.z, 1.0};
+    if (stream && lod_pixels >= 0) {
+        cerr << "--lod needs the whole model in memory and can't be used with --stream" << endl;
+        return 1;
+    }
 
-        tri[vert] = view_pos.xyz();  // view space
-        return Perspective * view_pos;
+    if (serve) {
+        RenderServer server(workers, max(1, cache_size));
+        return socket_path.empty() ? server.serve_stdin() : server.serve_socket(socket_path);
     }
 
-    virtual pair<bool, TGAColor> fragment(const vec3 bar) const {
-        vec3 n = normalized(cross(tri[1] - tri[0], tri[2] - tri[0]));
-        TGAColor color;
-        color[0] = (n.x * 0.5 + 0.5) * 255;
-        color[1] = (n.y * 0.5 + 0.5) * 255;
-        color[2] = (n.z * 0.5 + 0.5) * 255;
-        color[3] = 255;
-        return {false, color};
+    // the target only holds the requested region of the width x height frame
+    Region region = requested.value_or(Region{0, 0, width, height});
+    if (const char *err = region_error(width, height, region)) {
+        cerr << err << " (" << width << "x" << height << " frame)" << endl;
+        return 1;
     }
-};
-int main() {
-    TGAImage framebuffer(width, height, TGAImage::RGB);
-    vector<float> zbuffer(width * height, -numeric_limits<float>::infinity());
+    TGAImage framebuffer(region.w, region.h, TGAImage::RGB);
+    vector<float> zbuffer(size_t(region.w) * region.h, -numeric_limits<float>::infinity());
 
     constexpr vec3 eye{-1, 0, 2};
     constexpr vec3 center{0, 0, 0};
@@ -42,16 +73,41 @@ int main() {
     perspective(norm(eye - center));
     viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8);
 
-    Model model("diablo3_pose.obj");
-    RandomShader shader(model);
+    RandomShader shader;
+
+    if (stream) {
+        // rasterize batches while the parser thread keeps reading the file
+        ModelStream model(filename);
+        vector<StreamedFace> batch;
+        while (model.next(batch)) {
+            for (const StreamedFace &face : batch) {
+                Triangle clip;
+                clip[0] = shader.vertex(face.v[0], 0);
+                clip[1] = shader.vertex(face.v[1], 1);
+                clip[2] = shader.vertex(face.v[2], 2);
+
+                rasterize(clip, shader, framebuffer, zbuffer, region);
+            }
+        }
+    } else {
+        Model model(filename);
+
+        // with --lod, draw the coarsest level that stays within lod_pixels of the full mesh
+        unique_ptr<LodChain> lods;
+        const Model *mesh = &model;
+        if (lod_pixels >= 0) {
+            lods = make_unique<LodChain>(model);
+            mesh = &lods->level(lods->select(lod_pixels));
+        }
 
-    for (int face = 0; face < model.nfaces(); face++) {
-        Triangle clip;
-        clip[0] = shader.vertex(face, 0);
-        clip[1] = shader.vertex(face, 1);
-        clip[2] = shader.vertex(face, 2);
+        for (int face = 0; face < mesh->nfaces(); face++) {
+            Triangle clip;
+            clip[0] = shader.vertex(mesh->vert(face, 0), 0);
+            clip[1] = shader.vertex(mesh->vert(face, 1), 1);
+            clip[2] = shader.vertex(mesh->vert(face, 2), 2);
 
-        rasterize(clip, shader, framebuffer, zbuffer);
+            rasterize(clip, shader, framebuffer, zbuffer, region);
+        }
     }
 
     framebuffer.write_tga_file("framebuffer.tga");
@@ -25,8 +25,10 @@ Model::Model(const std::string &filename) {
             std::string a, b, c;
             ss >> a >> b >> c;
 
-            auto getIndex = [](const std::string &s) {
-                return std::stoi(s.substr(0, s.find('/'))) - 1;
+            // negative indices count back from the last vertex read so far
+            auto getIndex = [this](const std::string &s) {
+                int i = std::stoi(s.substr(0, s.find('/')));
+                return i < 0 ? nverts() + i : i - 1;
             };
 
             int i0 = getIndex(a);
@@ -36,6 +38,16 @@ Model::Model(const std::string &filename) {
             faces.push_back({i0, i1, i2});
         }
     }
+
+    // a face pointing past the vertex list would be read out of bounds by vert()
+    for (const std::vector<int> &face : faces)
+        for (int i : face)
+            if (i < 0 || i >= nverts()) {
+                std::cerr << "Face refers to a missing vertex in " << filename << std::endl;
+                vertices.clear();
+                faces.clear();
+                return;
+            }
 }
 
 int Model::nverts() const { return vertices.size(); }
@@ -48,3 +60,103 @@ vec3 Model::vert(const int i) const {
 vec3 Model::vert(const int iface, const int nthvert) const {
     return vertices[faces[iface][nthvert]];
 }
+
+ModelStream::ModelStream(const std::string &filename, const size_t batch_size, const size_t max_batches)
+    : batch_size(batch_size ? batch_size : 1), max_batches(max_batches ? max_batches : 1) {
+    parser = std::thread(&ModelStream::parse, this, filename);
+}
+
+ModelStream::~ModelStream() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        cancelled = true;
+    }
+    not_full.notify_all();
+    if (parser.joinable()) parser.join();
+}
+
+bool ModelStream::next(std::vector<StreamedFace> &batch) {
+    std::unique_lock<std::mutex> lock(mtx);
+    not_empty.wait(lock, [this] { return !queue.empty() || done; });
+    if (queue.empty()) return false;
+    batch = std::move(queue.front());
+    queue.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+}
+
+void ModelStream::parse(const std::string filename) {
+    std::vector<char> chunk(1 << 20);  // read the file in large chunks instead of the default buffer
+    std::ifstream in;
+    in.rdbuf()->pubsetbuf(chunk.data(), chunk.size());
+    in.open(filename);
+
+    // returns false if the consumer went away while we were waiting for room
+    auto push = [this](std::vector<StreamedFace> &batch) {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this] { return queue.size() < max_batches || cancelled; });
+        if (cancelled) return false;
+        queue.push_back(std::move(batch));
+        lock.unlock();
+        not_empty.notify_one();
+        batch.clear();
+        batch.reserve(batch_size);
+        return true;
+    };
+
+    if (!in) {
+        std::cerr << "Error opening file " << filename << std::endl;
+    } else {
+        std::vector<StreamedFace> batch;
+        batch.reserve(batch_size);
+        int skipped = 0;
+        bool alive = true;
+
+        std::string line;
+        while (alive && std::getline(in, line)) {
+            std::stringstream ss(line);
+            std::string type;
+            ss >> type;
+
+            if (type == "v") {
+                float x, y, z;
+                ss >> x >> y >> z;
+                vertices.push_back(vec3(x, y, z));
+            }
+            else if (type == "f") {
+                std::string a, b, c;
+                ss >> a >> b >> c;
+
+                // negative indices count back from the last vertex read so far
+                auto getIndex = [this](const std::string &s) {
+                    int i = std::stoi(s.substr(0, s.find('/')));
+                    return i < 0 ? int(vertices.size()) + i : i - 1;
+                };
+
+                // faces are resolved on the spot, so they may only refer to vertices seen so far
+                int idx[3];
+                try { idx[0] = getIndex(a); idx[1] = getIndex(b); idx[2] = getIndex(c); }
+                catch (const std::exception &) { skipped++; continue; }    // would end the whole process on this thread
+                StreamedFace face;
+                bool valid = true;
+                for (int i = 0; i < 3; i++) {
+                    if (idx[i] < 0 || idx[i] >= int(vertices.size())) { valid = false; break; }
+                    face.v[i] = vertices[idx[i]];
+                }
+                if (!valid) { skipped++; continue; }
+
+                batch.push_back(face);
+                if (batch.size() >= batch_size) alive = push(batch);
+            }
+        }
+        if (alive && !batch.empty()) push(batch);
+        if (skipped) std::cerr << "Skipped " << skipped << " malformed faces or faces with forward or invalid vertex references in " << filename << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        done = true;
+    }
+    not_empty.notify_all();
+}
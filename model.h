@@ -1,10 +1,15 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "geometry.h"
 
 class Model {
     public:
+    Model() = default;
     Model(const std::string & filename);
 
 
@@ -15,4 +20,35 @@ class Model {
     int nfaces() const;
     vec3 vert(const int i) const;
     vec3 vert(const int iface, const int nthvert) const;
-};
\ No newline at end of file
+};
+
+// a face with its vertex positions already looked up
+struct StreamedFace {
+    vec3 v[3];
+};
+
+// Out-of-core reader: a parser thread walks the obj file and hands batches of
+// resolved faces through a bounded queue. Besides the vertex array, at most
+// (max_batches + 2) * batch_size faces are held in memory: the queued batches,
+// the one the parser is filling and the one the consumer got from next().
+class ModelStream {
+    public:
+    ModelStream(const std::string & filename, const size_t batch_size = 1 << 16, const size_t max_batches = 4);
+    ~ModelStream();
+    ModelStream(const ModelStream &) = delete;
+    ModelStream & operator=(const ModelStream &) = delete;
+
+    // blocks until a batch is ready, returns false once the file is exhausted
+    bool next(std::vector<StreamedFace> & batch);
+
+    private:
+    void parse(const std::string filename);
+
+    const size_t batch_size, max_batches;
+    std::vector<vec3> vertices;     // owned by the parser thread
+    std::deque<std::vector<StreamedFace>> queue;
+    std::mutex mtx;
+    std::condition_variable not_empty, not_full;
+    bool done = false, cancelled = false;
+    std::thread parser;
+};
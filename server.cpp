@@ -0,0 +1,461 @@
+#include "server.h"
+#include "gl.h"
+#include "shader.h"
+#include "config.h"
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool parse_vec3(const std::string &s, vec3 &v) {
+    std::stringstream ss(s);
+    char c1, c2;
+    return (ss >> v.x >> c1 >> v.y >> c2 >> v.z) && c1 == ',' && c2 == ',';
+}
+
+bool parse_job(const std::string &line, RenderJob &job, std::string &err) {
+    std::stringstream ss(line);
+    std::string token;
+    while (ss >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos) { err = "expected key=value, got " + token; return false; }
+        std::string key = token.substr(0, eq), value = token.substr(eq + 1);
+
+        bool ok = true;
+        if (key == "id") job.id = value;
+        else if (key == "model") job.model = value;
+        else if (key == "out") job.out = value;
+        else if (key == "eye") ok = parse_vec3(value, job.eye);
+        else if (key == "center") ok = parse_vec3(value, job.center);
+        else if (key == "up") ok = parse_vec3(value, job.up);
+        else if (key == "width" || key == "height") {
+            try { (key == "width" ? job.width : job.height) = std::stoi(value); }
+            catch (const std::exception &) { ok = false; }
+        }
+        else if (key == "lod") {
+            try { job.lod_pixels = std::stod(value); }
+            catch (const std::exception &) { ok = false; }
+        }
+        else if (key == "region") {
+            Region &r = job.region.emplace();
+            ok = sscanf(value.c_str(), "%d,%d,%d,%d", &r.x, &r.y, &r.w, &r.h) == 4;
+        }
+        else if (key == "format") {
+            if (value == "tga") job.rle = true;
+            else if (value == "tga-raw") job.rle = false;
+            else ok = false;
+        }
+        else { err = "unknown key " + key; return false; }
+
+        if (!ok) { err = "bad value for " + key; return false; }
+    }
+    if (job.width == 0) job.width = default_width;
+    if (job.height == 0) job.height = default_height;
+
+    if (!job.region) job.region = Region{0, 0, job.width, job.height};
+    if (const char *e = region_error(job.width, job.height, *job.region)) {
+        err = e;
+        return false;
+    }
+    return true;
+}
+
+CachedModel::CachedModel(const std::string &filename) : model(filename) {}
+
+const LodChain & CachedModel::lods() const {
+    std::call_once(built, [this] { chain = std::make_unique<LodChain>(model); });
+    return *chain;
+}
+
+ModelCache::ModelCache(const size_t capacity) : capacity(capacity ? capacity : 1) {}
+
+std::shared_ptr<const CachedModel> ModelCache::get(const std::string &filename) {
+    std::promise<std::shared_ptr<const CachedModel>> loading;
+    std::shared_future<std::shared_ptr<const CachedModel>> cached;
+    size_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(filename);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            nhits++;
+            cached = it->second->model;
+        } else {
+            nmisses++;
+            generation = ++generations;
+            lru.push_front({filename, loading.get_future().share(), generation});
+            index[filename] = lru.begin();
+            if (lru.size() > capacity) {
+                index.erase(lru.back().filename);
+                lru.pop_back();
+            }
+        }
+    }
+    // may wait for another worker's parse, so outside the lock
+    if (cached.valid()) return cached.get();
+
+    // forget a failed load, unless the entry was evicted and reloaded meanwhile
+    auto forget = [this, &filename, generation] {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(filename);
+        if (it != index.end() && it->second->generation == generation) {
+            lru.erase(it->second);
+            index.erase(it);
+        }
+    };
+
+    // parse outside the lock so other workers keep going
+    std::shared_ptr<const CachedModel> model;
+    try {
+        model = std::make_shared<const CachedModel>(filename);
+    } catch (...) {
+        forget();
+        loading.set_exception(std::current_exception());
+        throw;
+    }
+    if (!model->model.nfaces()) {
+        forget();
+        model = nullptr;
+    }
+    loading.set_value(model);
+    return model;
+}
+
+size_t ModelCache::hits() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return nhits;
+}
+
+size_t ModelCache::misses() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return nmisses;
+}
+
+TargetPool::TargetPool(const size_t max_bytes) : max_bytes(max_bytes) {}
+
+size_t TargetPool::bytes(const RenderTarget &target) {
+    return size_t(target.framebuffer.width()) * target.framebuffer.height() * TGAImage::RGB
+         + target.zbuffer.size() * sizeof(float);
+}
+
+std::unique_ptr<RenderTarget> TargetPool::acquire(const int w, const int h) {
+    std::unique_ptr<RenderTarget> target;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(free.begin(), free.end(), [w, h](const auto &t) {
+            return t->framebuffer.width() == w && t->framebuffer.height() == h;
+        });
+        if (it != free.end()) {
+            target = std::move(*it);
+            free.erase(it);
+            free_bytes -= bytes(*target);
+        }
+    }
+    if (!target) {
+        target = std::make_unique<RenderTarget>();
+        target->framebuffer = TGAImage(w, h, TGAImage::RGB);
+        target->zbuffer.resize(size_t(w) * h);
+    } else {
+        target->framebuffer.clear();
+    }
+    std::fill(target->zbuffer.begin(), target->zbuffer.end(), -std::numeric_limits<float>::infinity());
+    return target;
+}
+
+void TargetPool::release(std::unique_ptr<RenderTarget> target) {
+    std::lock_guard<std::mutex> lock(mtx);
+    free_bytes += bytes(*target);
+    free.push_back(std::move(target));
+    while (free_bytes > max_bytes) {
+        free_bytes -= bytes(*free.front());
+        free.pop_front();
+    }
+}
+
+ServerStats::ServerStats() : start(std::chrono::steady_clock::now()) {}
+
+void ServerStats::record(const double queue_ms, const double render_ms, const bool ok) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!ok) { failed++; return; }
+    completed++;
+    Latency l{queue_ms, render_ms, queue_ms + render_ms};
+    sum = {sum.queue + l.queue, sum.render + l.render, sum.total + l.total};
+    peak = {std::max(peak.queue, l.queue), std::max(peak.render, l.render), std::max(peak.total, l.total)};
+    latencies.push_back(l);
+    if (latencies.size() > window) latencies.pop_front();
+}
+
+std::string ServerStats::report(const ModelCache &cache) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "stats completed=%zu failed=%zu uptime_s=%.1f jobs_per_s=%.2f",
+             completed, failed, uptime, uptime > 0 ? completed / uptime : 0.);
+    std::string out = buf;
+
+    // mean, percentiles and max for each part of the latency
+    auto summarize = [&](const char *name, double Latency::*field) {
+        std::vector<double> sorted;
+        for (const Latency &l : latencies) sorted.push_back(l.*field);
+        std::sort(sorted.begin(), sorted.end());
+        auto pct = [&sorted](const double p) {
+            return sorted.empty() ? 0. : sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+        };
+        snprintf(buf, sizeof(buf), " %s_mean_ms=%.1f %s_p50_ms=%.1f %s_p95_ms=%.1f %s_p99_ms=%.1f %s_max_ms=%.1f",
+                 name, completed ? sum.*field / completed : 0., name, pct(.5), name, pct(.95), name, pct(.99),
+                 name, peak.*field);
+        out += buf;
+    };
+    summarize("total", &Latency::total);
+    summarize("queue", &Latency::queue);
+    summarize("render", &Latency::render);
+
+    snprintf(buf, sizeof(buf), " cache_hits=%zu cache_misses=%zu", cache.hits(), cache.misses());
+    return out + buf;
+}
+
+RenderServer::RenderServer(const int nworkers, const size_t cache_size) : cache(cache_size) {
+    for (int i = 0; i < std::max(1, nworkers); i++)
+        workers.emplace_back(&RenderServer::work, this);
+}
+
+RenderServer::~RenderServer() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for (std::thread &t : workers) t.join();
+}
+
+void RenderServer::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            job_ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            running++;
+        }
+        job();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            running--;
+        }
+        idle.notify_all();
+    }
+}
+
+void RenderServer::submit(const RenderJob &job, const Reply &reply) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto queued = std::chrono::steady_clock::now();
+        jobs.push_back([this, job, reply, queued] {
+            auto t0 = std::chrono::steady_clock::now();
+            std::string err;
+            bool ok;
+            // a bad input must fail its own job, not take the server down
+            try { ok = render(job, err); }
+            catch (const std::exception &e) {
+                ok = false;
+                err = e.what();
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            double queue_ms = std::chrono::duration<double, std::milli>(t0 - queued).count();
+            double render_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            stats.record(queue_ms, render_ms, ok);
+            if (ok) reply("ok " + job.id + " " + std::to_string(queue_ms + render_ms));
+            else reply("error " + job.id + " " + err);
+        });
+    }
+    job_ready.notify_one();
+}
+
+bool RenderServer::render(const RenderJob &job, std::string &err) {
+    std::shared_ptr<const CachedModel> cached = cache.get(job.model);
+    if (!cached) { err = "can't load " + job.model; return false; }
+
+    // the matrices are thread_local, so each worker has its own camera
+    lookat(job.eye, job.center, job.up);
+    perspective(norm(job.eye - job.center));
+    viewport(job.width / 16, job.height / 16, job.width * 7 / 8, job.height * 7 / 8);
+
+    const Model *model = &cached->model;
+    if (job.lod_pixels >= 0) {
+        const LodChain &lods = cached->lods();
+        model = &lods.level(lods.select(job.lod_pixels));
+    }
+
+    std::unique_ptr<RenderTarget> target = targets.acquire(job.region->w, job.region->h);
+    RandomShader shader;
+    for (int face = 0; face < model->nfaces(); face++) {
+        Triangle clip;
+        clip[0] = shader.vertex(model->vert(face, 0), 0);
+        clip[1] = shader.vertex(model->vert(face, 1), 1);
+        clip[2] = shader.vertex(model->vert(face, 2), 2);
+
+        rasterize(clip, shader, target->framebuffer, target->zbuffer, *job.region);
+    }
+
+    bool ok = target->framebuffer.write_tga_file(job.out, true, job.rle);
+    targets.release(std::move(target));
+    if (!ok) err = "can't write " + job.out;
+    return ok;
+}
+
+bool RenderServer::dispatch(const std::string &line, const Reply &reply) {
+    std::stringstream ss(line);
+    std::string command;
+    ss >> command;
+
+    if (command.empty()) return true;
+    if (command == "quit") return false;
+    if (command == "stats") {
+        reply(stats.report(cache));
+        return true;
+    }
+    if (command == "render") {
+        RenderJob job;
+        std::string rest, err;
+        std::getline(ss, rest);
+        if (parse_job(rest, job, err)) submit(job, reply);
+        else {
+            stats.record(0, 0, false);
+            reply("error " + job.id + " " + err);
+        }
+        return true;
+    }
+    reply("error - unknown command " + command);
+    return true;
+}
+
+int RenderServer::serve_stdin() {
+    auto out_mtx = std::make_shared<std::mutex>();
+    Reply reply = [out_mtx](const std::string &msg) {
+        std::lock_guard<std::mutex> lock(*out_mtx);
+        std::cout << msg << std::endl;
+    };
+
+    std::string line;
+    while (std::getline(std::cin, line) && dispatch(line, reply));
+
+    // let in-flight jobs finish before the caller tears us down
+    std::unique_lock<std::mutex> lock(mtx);
+    idle.wait(lock, [this] { return jobs.empty() && !running; });
+    return 0;
+}
+
+int RenderServer::serve_socket(const std::string &path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) { perror("socket"); return 1; }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "socket path too long: " << path << std::endl;
+        close(listener);
+        return 1;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    // replace a stale socket from an earlier run, but never any other kind of file
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << path << " exists and is not a socket" << std::endl;
+            close(listener);
+            return 1;
+        }
+        unlink(path.c_str());
+    }
+    if (bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+        perror(path.c_str());
+        close(listener);
+        return 1;
+    }
+    std::cerr << "listening on " << path << std::endl;
+
+    // replies share a client's fd, which is closed once the client hung up and
+    // the last pending job has answered
+    struct Connection {
+        int fd;
+        std::mutex mtx;
+        ~Connection() { close(fd); }
+    };
+    struct Client {
+        std::weak_ptr<Connection> conn;
+        std::shared_ptr<std::atomic<bool>> done;
+        std::thread reader;
+    };
+    std::list<Client> clients;
+
+    while (true) {
+        // join readers whose client hung up
+        clients.remove_if([](Client &c) {
+            if (!*c.done) return false;
+            c.reader.join();
+            return true;
+        });
+
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            const int err = errno;
+            if (err == EINTR || err == ECONNABORTED) continue;
+            perror("accept");
+            // out of descriptors or memory: wait for running jobs to free some
+            if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            break;
+        }
+
+        auto conn = std::make_shared<Connection>();
+        conn->fd = client;
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        std::thread reader([this, conn, done] {
+            Reply reply = [conn](const std::string &msg) {
+                std::lock_guard<std::mutex> lock(conn->mtx);
+                std::string out = msg + "\n";
+                for (size_t sent = 0; sent < out.size(); ) {
+                    ssize_t n = send(conn->fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+                    if (n <= 0) return;
+                    sent += n;
+                }
+            };
+
+            std::string pending;
+            char buf[4096];
+            ssize_t n;
+            bool open = true;
+            while (open && (n = recv(conn->fd, buf, sizeof(buf), 0)) > 0) {
+                pending.append(buf, n);
+                size_t eol;
+                while (open && (eol = pending.find('\n')) != std::string::npos) {
+                    open = dispatch(pending.substr(0, eol), reply);
+                    pending.erase(0, eol + 1);
+                }
+            }
+            *done = true;
+        });
+        clients.push_back({conn, done, std::move(reader)});
+    }
+
+    // the readers call back into the server, so they must be gone before it is
+    close(listener);
+    for (Client &c : clients) {
+        if (auto conn = c.conn.lock()) shutdown(conn->fd, SHUT_RDWR);
+        c.reader.join();
+    }
+    return 1;
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <chrono>
+#include "geometry.h"
+#include "model.h"
+#include "tgaimage.h"
+#include "gl.h"
+#include "lod.h"
+
+// Long-running render server. Jobs are read one per line, either from stdin or
+// from clients of a Unix socket, and rendered concurrently on a worker pool:
+//
+//   render id=7 model=diablo3_pose.obj eye=-1,0,2 center=0,0,0 up=0,1,0 width=3000 height=3000 region=0,0,1500,1500 out=a.tga format=tga
+//
+// lod=px draws the coarsest level of detail whose error stays within px pixels
+// on screen; levels are built on first use and cached with the model.
+//
+// region=x,y,w,h renders only that rectangle of the width x height frame into a
+// w x h image (see Region in gl.h), so a frame can be split across servers.
+//
+//   stats
+//   quit                      (stdin only: finish pending jobs and exit)
+//
+// Every job answers with a single line, "ok <id> <ms>" or "error <id> <reason>",
+// where ms is the end-to-end latency including the wait for a free worker;
+// since jobs run in parallel, answers come back in completion order.
+
+struct RenderJob {
+    std::string id = "-";
+    std::string model = "diablo3_pose.obj";
+    vec3 eye{-1, 0, 2};
+    vec3 center{0, 0, 0};
+    vec3 up{0, 1, 0};
+    int width = 0, height = 0;  // 0 means the compiled default
+    std::optional<Region> region;   // the whole frame if not given
+    double lod_pixels = -1;     // negative always draws the full mesh
+    std::string out = "framebuffer.tga";
+    bool rle = true;
+};
+
+// parses the arguments of a "render" line, returns false and sets err on bad input
+bool parse_job(const std::string &line, RenderJob &job, std::string &err);
+
+// a parsed model together with its levels of detail
+class CachedModel {
+    public:
+    CachedModel(const std::string &filename);
+    const Model model;
+    const LodChain & lods() const;   // simplified on first use
+
+    private:
+    mutable std::once_flag built;
+    mutable std::unique_ptr<LodChain> chain;
+};
+
+// LRU cache of parsed models, shared between workers
+class ModelCache {
+    public:
+    ModelCache(const size_t capacity);
+    std::shared_ptr<const CachedModel> get(const std::string &filename);
+    size_t hits() const;
+    size_t misses() const;
+
+    private:
+    // a model still being parsed is already listed, so later requests for the
+    // same file wait on its future instead of parsing it again
+    struct Entry {
+        std::string filename;
+        std::shared_future<std::shared_ptr<const CachedModel>> model;
+        size_t generation;      // tells a reloaded entry apart from an evicted one
+    };
+    typedef std::list<Entry> Entries;
+    const size_t capacity;
+    Entries lru;    // most recently used first
+    std::unordered_map<std::string, Entries::iterator> index;
+    mutable std::mutex mtx;
+    size_t nhits = 0, nmisses = 0, generations = 0;
+};
+
+struct RenderTarget {
+    TGAImage framebuffer;
+    std::vector<float> zbuffer;
+};
+
+// frame and depth buffers recycled between jobs of the same resolution; idle
+// buffers past max_bytes are freed oldest first, so odd sizes don't pile up
+class TargetPool {
+    public:
+    TargetPool(const size_t max_bytes = size_t(1) << 30);
+    std::unique_ptr<RenderTarget> acquire(const int w, const int h);
+    void release(std::unique_ptr<RenderTarget> target);
+
+    private:
+    static size_t bytes(const RenderTarget &target);
+
+    const size_t max_bytes;
+    std::deque<std::unique_ptr<RenderTarget>> free;     // oldest first
+    size_t free_bytes = 0;
+    std::mutex mtx;
+};
+
+// latency / throughput counters, reported by the "stats" command; a job's
+// latency is the time it waited in the queue plus the time it took to render
+class ServerStats {
+    public:
+    ServerStats();
+    void record(const double queue_ms, const double render_ms, const bool ok);
+    std::string report(const ModelCache &cache) const;
+
+    private:
+    struct Latency {
+        double queue = 0, render = 0, total = 0;
+    };
+    static constexpr size_t window = 1024;  // latencies kept for the percentiles
+    const std::chrono::steady_clock::time_point start;
+    std::deque<Latency> latencies;
+    size_t completed = 0, failed = 0;
+    Latency sum, peak;
+    mutable std::mutex mtx;
+};
+
+class RenderServer {
+    public:
+    RenderServer(const int workers, const size_t cache_size);
+    ~RenderServer();
+
+    int serve_stdin();
+    int serve_socket(const std::string &path);
+
+    private:
+    typedef std::function<void(const std::string &)> Reply;
+
+    // handles one request line, returns false on "quit"
+    bool dispatch(const std::string &line, const Reply &reply);
+    void submit(const RenderJob &job, const Reply &reply);
+    void work();
+    bool render(const RenderJob &job, std::string &err);
+
+    ModelCache cache;
+    TargetPool targets;
+    ServerStats stats;
+
+    std::deque<std::function<void()>> jobs;
+    std::mutex mtx;
+    std::condition_variable job_ready, idle;
+    size_t running = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
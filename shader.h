@@ -0,0 +1,23 @@
+#pragma once
+#include "gl.h"
+
+struct RandomShader : IShader {
+    vec3 tri[3];
+
+    virtual vec4 vertex(const vec3 v, const int vert) {
+        vec4 view_pos = ModelView * vec4{v.x, v.y, v.z, 1.0};
+
+        tri[vert] = view_pos.xyz();  // view space
+        return Perspective * view_pos;
+    }
+
+    virtual pair<bool, TGAColor> fragment(const vec3 bar) const {
+        vec3 n = normalized(cross(tri[1] - tri[0], tri[2] - tri[0]));
+        TGAColor color;
+        color[0] = (n.x * 0.5 + 0.5) * 255;
+        color[1] = (n.y * 0.5 + 0.5) * 255;
+        color[2] = (n.z * 0.5 + 0.5) * 255;
+        color[3] = 255;
+        return {false, color};
+    }
+};
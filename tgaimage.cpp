@@ -1,8 +1,9 @@
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 #include "tgaimage.h"
 
-TGAImage::TGAImage(const int w, const int h, const int bpp) : w(w), h(h), bpp(bpp), data(w*h*bpp, 0) {}
+TGAImage::TGAImage(const int w, const int h, const int bpp) : w(w), h(h), bpp(bpp), data(size_t(w)*h*bpp, 0) {}
 
 bool TGAImage::read_tga_file(const std::string filename) {
     std::ifstream in;
@@ -178,6 +179,10 @@ void TGAImage::set(int x, int y, const TGAColor &c) {
     memcpy(data.data()+(x+y*w)*bpp, c.bgra, bpp);
 }
 
+void TGAImage::clear() {
+    std::fill(data.begin(), data.end(), 0);
+}
+
 void TGAImage::flip_horizontally() {
     for (int i=0; i<w/2; i++)
         for (int j=0; j<h; j++)